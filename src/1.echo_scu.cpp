@@ -14,6 +14,7 @@
 #include "dcmtk/ofstd/ofstd.h"
 #include "dcmtk/ofstd/ofstring.h"
 #include "log.hpp"
+#include "peer_group.hpp"
 #include "tls_helper.hpp"
 
 namespace {
@@ -25,108 +26,71 @@ static const char* transfer_syntaxes[] = {
 };
 }  // namespace
 
-int main(int argc, char** argv) {
-  cxxopts::Options options("EchoScu", "Echo Scu");
-  // default dicom port of orthanc
-
-  // clang-format off
-  options.add_options()
-  ("H,host", "Server address", cxxopts::value<std::string>()->default_value("localhost"))
-  ("p,port", "Server port", cxxopts::value<int>()->default_value("4646"))
-  ("t,title", "Server Application title", cxxopts::value<std::string>()->default_value("ANY_SCP"))
-  ("h,help", "Print usage");
-  // clang-format on
-  cxxopts::ParseResult args;
-  try {
-    args = options.parse(argc, argv);
-    if (args.count("help")) {
-      fmt::print(options.help());
-      return EXIT_SUCCESS;
-    }
-  } catch (cxxopts::OptionException* e) {
-    fmt::print(options.help());
-    return EXIT_SUCCESS;
-  }
-
-  dcmtk::log4cplus::Logger::getRoot().setLogLevel(dcmtk::log4cplus::TRACE_LOG_LEVEL);
-
-  OFStandard::initializeNetwork();
-
-  // socket
-  constexpr auto socket_time_out = 5;
-  dcmSocketSendTimeout.set(socket_time_out);
-  dcmSocketReceiveTimeout.set(socket_time_out);
-
-  // load private tags
-  if (!dcmDataDict.isDictionaryLoaded()) {
-    LOGD("no dictionary loaded, check environment variable:{}", DCM_DICT_ENVIRONMENT_VARIABLE);
-  }
-
+/**
+ * @brief associate with peer over asc_network and send one C-ECHO
+ */
+peer::Result request(T_ASC_Network* asc_network, const peer::Peer& peer, const peer::Timeouts& timeouts) {
   OFString error_msg;
 
-  T_ASC_Network* asc_network;
-  constexpr auto asc_timeout = 10;
-  auto cond = ASC_initializeNetwork(NET_REQUESTOR, 0, asc_timeout, &asc_network);
-  if (cond.bad()) {
-    LOGD("asociation initialize network failed:{}", DimseCondition::dump(error_msg, cond));
-    return EXIT_FAILURE;
-  }
-
   T_ASC_Parameters* asc_parameter;
-  cond = ASC_createAssociationParameters(&asc_parameter, ASC_DEFAULTMAXPDU);
+  auto cond = ASC_createAssociationParameters(&asc_parameter, ASC_DEFAULTMAXPDU);
   if (cond.bad()) {
     LOGD("create association parameter failed:{}", DimseCondition::dump(error_msg, cond));
-    return EXIT_FAILURE;
+    return {cond};
   }
 
   tls::TslHeper tls;
   cond = tls.Init(asc_network, asc_parameter, res_path("client.key"), res_path("client.crt"), tls::EndPoint::kClient);
   if (cond.bad()) {
     LOGE("Initialize TLS failed:{}", err_msg(cond));
-    return EXIT_FAILURE;
+    ASC_destroyAssociationParameters(&asc_parameter);
+    return {cond};
   }
 
   cond = tls.AddTrustedCertificate(res_path("server.crt"));
   if (cond.bad()) {
     LOGE("Add trusted certificate file failed:{}", err_msg(cond));
-    return EXIT_FAILURE;
+    ASC_destroyAssociationParameters(&asc_parameter);
+    return {cond};
   }
 
   constexpr auto our_app_title = "ECHOSCU";
-  const auto peer_app_title = args["title"].as<std::string>();
-  const auto peer_host = args["host"].as<std::string>();
-  const auto peer_port = args["port"].as<int>();
-  ASC_setAPTitles(asc_parameter, our_app_title, peer_app_title.c_str(), nullptr);
+  ASC_setAPTitles(asc_parameter, our_app_title, peer.title.c_str(), nullptr);
   ASC_setPresentationAddresses(asc_parameter, OFStandard::getHostName().c_str(),
-                               fmt::format("{}:{}", peer_host, peer_port).c_str());
+                               fmt::format("{}:{}", peer.host, peer.port).c_str());
 
   constexpr auto asc_transfer_syntax_num = 1;
   cond = ASC_addPresentationContext(asc_parameter, 1, UID_VerificationSOPClass, transfer_syntaxes,
                                     asc_transfer_syntax_num);
   if (cond.bad()) {
     LOGW("Add presentation context failed:{}", DimseCondition::dump(error_msg, cond));
-    return EXIT_FAILURE;
+    ASC_destroyAssociationParameters(&asc_parameter);
+    return {cond};
   }
 
   LOGI("Request parameters:\n{}", ASC_dumpParameters(error_msg, asc_parameter, ASC_ASSOC_RQ));
-  LOGI("Connecting to {}:{}", peer_host, peer_port);
-  T_ASC_Association* asc_association;
+  LOGI("Connecting to {}:{}", peer.host, peer.port);
+  T_ASC_Association* asc_association = nullptr;
   cond = ASC_requestAssociation(asc_network, asc_parameter, &asc_association);
   if (cond.bad()) {
     if (cond == DUL_ASSOCIATIONREJECTED) {
       T_ASC_RejectParameters rej;
       ASC_getRejectParameters(asc_parameter, &rej);
       LOGD("Association rejected:{}", ASC_printRejectParameters(error_msg, &rej));
-      return EXIT_FAILURE;
     } else {
       LOGD("Association Request failed:{}", DimseCondition::dump(error_msg, cond));
     }
+    // association owns the parameters from now on
+    ASC_destroyAssociation(&asc_association);
+    return {cond};
   }
 
   LOGD("Association parameter negotiated:\n{}", ASC_dumpParameters(error_msg, asc_parameter, ASC_ASSOC_AC));
   if (ASC_countAcceptedPresentationContexts(asc_parameter) == 0) {
     LOGD("No acceptable presentation contexts");
-    return EXIT_FAILURE;
+    ASC_abortAssociation(asc_association);
+    ASC_destroyAssociation(&asc_association);
+    return {NET_EC_NoAcceptablePresentationContexts};
   }
   LOGD("Assocation accepted, max send PDV:{}", asc_association->sendPDVLength);
 
@@ -135,7 +99,7 @@ int main(int argc, char** argv) {
   DcmDataset* status_details = nullptr;
   LOGD("Sending echo request, message id:{}", msg_id);
 
-  cond = DIMSE_echoUser(asc_association, msg_id, DIMSE_NONBLOCKING, 10, &status, &status_details);
+  cond = DIMSE_echoUser(asc_association, msg_id, DIMSE_NONBLOCKING, timeouts.dimse, &status, &status_details);
   if (cond.good()) {
     LOGD("Received echo response:{}", DU_cechoStatusString(status));
   } else {
@@ -149,19 +113,23 @@ int main(int argc, char** argv) {
     delete status_details;
   }
 
+  // the exchange went through but a non-Success status still fails the request
+  peer::Result result{cond, true};
+  if (cond.good() && status != STATUS_Success) {
+    result.cond = makeOFCondition(OFM_dcmnet, 1000, OF_error,
+                                  fmt::format("C-ECHO status:{}", DU_cechoStatusString(status)).c_str());
+  }
   if (cond == EC_Normal) {
     LOGD("Release association");
     cond = ASC_releaseAssociation(asc_association);
     if (cond.bad()) {
       LOGD("Association release failed:{}", DimseCondition::dump(error_msg, cond));
-      return EXIT_FAILURE;
     }
   } else if (cond == DUL_PEERREQUESTEDRELEASE) {
     LOGD("Protocol error: peer requested to release, aborting...");
     cond = ASC_abortAssociation(asc_association);
     if (cond.bad()) {
       LOGD("Association abort failed:{}", DimseCondition::dump(error_msg, cond));
-      return EXIT_FAILURE;
     }
   } else if (cond == DUL_PEERABORTEDASSOCIATION) {
     LOGD("Peer aborted association");
@@ -170,17 +138,85 @@ int main(int argc, char** argv) {
     cond = ASC_abortAssociation(asc_association);
     if (cond.bad()) {
       LOGD("Association abort failed:{}", DimseCondition::dump(error_msg, cond));
-      return EXIT_FAILURE;
     }
   }
 
+  ASC_destroyAssociation(&asc_association);
+  return result;
+}
+
+/**
+ * @brief one C-ECHO on its own network and association, may run concurrently with other attempts
+ */
+peer::Result echo(const peer::Peer& peer, const peer::Timeouts& timeouts) {
+  OFString error_msg;
+
+  T_ASC_Network* asc_network;
+  auto cond = ASC_initializeNetwork(NET_REQUESTOR, 0, timeouts.acse, &asc_network);
+  if (cond.bad()) {
+    LOGD("asociation initialize network failed:{}", DimseCondition::dump(error_msg, cond));
+    return {cond};
+  }
+
+  auto result = request(asc_network, peer, timeouts);
+
   cond = ASC_dropNetwork(&asc_network);
   if (cond.bad()) {
     LOGD("Drop network failed:{}", DimseCondition::dump(error_msg, cond));
-    return EXIT_FAILURE;
+  }
+
+  return result;
+}
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("EchoScu", "Echo Scu");
+  // default dicom port of orthanc
+  peer::add_options(options, "localhost", 4646);
+
+  // clang-format off
+  options.add_options()
+  ("h,help", "Print usage");
+  // clang-format on
+  cxxopts::ParseResult args;
+  try {
+    args = options.parse(argc, argv);
+    if (args.count("help")) {
+      fmt::print(options.help());
+      return EXIT_SUCCESS;
+    }
+  } catch (const cxxopts::OptionException& e) {
+    fmt::print(options.help());
+    return EXIT_SUCCESS;
+  }
+
+  dcmtk::log4cplus::Logger::getRoot().setLogLevel(dcmtk::log4cplus::TRACE_LOG_LEVEL);
+
+  OFStandard::initializeNetwork();
+
+  // socket
+  const auto timeouts = peer::timeouts_from_args(args);
+  peer::apply(timeouts);
+
+  // load private tags
+  if (!dcmDataDict.isDictionaryLoaded()) {
+    LOGD("no dictionary loaded, check environment variable:{}", DCM_DICT_ENVIRONMENT_VARIABLE);
+  }
+
+  // C-ECHO is idempotent, hedge it
+  auto failed = 0;
+  {
+    peer::Group group(peer::peers_from_args(args), peer::options_from_args(args));
+    const auto repeat = args["repeat"].as<int>();
+    for (auto i = 0; i < repeat; ++i) {
+      if (group.Run([timeouts](const peer::Peer& peer) { return echo(peer, timeouts); }, true).cond.bad()) {
+        ++failed;
+      }
+    }
+    group.Wait();
+    group.Report();
   }
 
   OFStandard::shutdownNetwork();
 
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,4 +1,9 @@
+#include <memory>
+#include <vector>
+
+#include "cxxopts.hpp"
 #include "dcmtk/dcmdata/dcdict.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
 #include "dcmtk/dcmdata/dcuid.h"
 #include "dcmtk/dcmdata/dcxfer.h"
 #include "dcmtk/dcmnet/cond.h"
@@ -8,36 +13,133 @@
 #include "dcmtk/ofstd/ofstd.h"
 #include "dcmtk/ofstd/oftypes.h"
 #include "log.hpp"
+#include "peer_group.hpp"
 
-int main(int argc, char **argv) {
-  // 1. initialize underline network
-  OFStandard::initializeNetwork();
+using Responses = std::vector<std::shared_ptr<DcmDataset>>;
+
+/**
+ * @brief keep responses in memory, hedged attempts run at the same time and must not write the same files
+ *
+ * DCMTK only honours cancelAfterNResponses in its default callback, so the C-CANCEL is sent here.
+ */
+class ResponseCallback : public DcmFindSCUCallback {
+ public:
+  explicit ResponseCallback(int cancel_after) : cancel_after_(cancel_after) {}
+
+  void callback(T_DIMSE_C_FindRQ *request, int &response_count, T_DIMSE_C_FindRSP *rsp,
+                DcmDataset *response_identifiers) override {
+    if (response_identifiers && (cancel_after_ <= 0 || response_count <= cancel_after_)) {
+      responses_.push_back(std::make_shared<DcmDataset>(*response_identifiers));
+    }
 
+    if (response_count == cancel_after_) {
+      LOGI("Cancel after {} responses", response_count);
+      auto cond = DIMSE_sendCancelRequest(assoc_, presId_, request->MessageID);
+      if (cond.bad()) {
+        OFString error;
+        LOGE("Cancel failed:{}", DimseCondition::dump(error, cond));
+      }
+    }
+  }
+
+  auto responses() const { return responses_; }
+
+ private:
+  int cancel_after_;
+  Responses responses_;
+};
+
+/**
+ * @brief one C-FIND with its own DcmFindSCU, may run concurrently with other attempts
+ */
+peer::Result find(const peer::Peer &peer, const peer::Timeouts &timeouts) {
   // 2. create DcmFindSCU
   DcmFindSCU find_scu;
 
   // 3 initialize association
-  auto cond = find_scu.initializeNetwork(10);
+  auto cond = find_scu.initializeNetwork(timeouts.acse);
   OFString error;
   if (cond.bad()) {
     LOGE("Initialize association network failed:{}", DimseCondition::dump(error, cond));
-    return EXIT_FAILURE;
+    return {cond};
   }
 
   // 4. find
+  constexpr auto cancel_after = 100;
   OFList<OFString> override_keys;
-  cond =
-      find_scu.performQuery("localhost", 4243, "FINDSCU", "ANY-SCP", UID_FINDPatientRootQueryRetrieveInformationModel,
-                            EXS_LittleEndianExplicit, DIMSE_BLOCKING, 0, ASC_DEFAULTMAXPDU, OFFalse, OFFalse, 1,
-                            FEM_dicomFile, 100, &override_keys, nullptr, nullptr, nullptr, nullptr);
+  ResponseCallback callback(cancel_after);
+  cond = find_scu.performQuery(peer.host.c_str(), peer.port, "FINDSCU", peer.title.c_str(),
+                               UID_FINDPatientRootQueryRetrieveInformationModel, EXS_LittleEndianExplicit,
+                               DIMSE_NONBLOCKING, timeouts.dimse, ASC_DEFAULTMAXPDU, OFFalse, OFFalse, 1, FEM_none,
+                               cancel_after, &override_keys, &callback, nullptr, nullptr, nullptr);
   if (cond.bad()) {
     LOGE("Query failed:{}", DimseCondition::dump(error, cond));
-    return EXIT_FAILURE;
   }
 
   // close connection
   find_scu.dropNetwork();
+
+  return {cond, false, callback.responses()};
+}
+
+/**
+ * @brief save the responses of the winning attempt of one request
+ */
+void save(const Responses &responses, int request) {
+  for (std::size_t i = 0; i < responses.size(); ++i) {
+    const auto path = fmt::format("rsp{:04}_{:04}.dcm", request + 1, i + 1);
+    DcmFileFormat file_format(responses[i].get());
+    auto cond = file_format.saveFile(path.c_str(), EXS_LittleEndianExplicit);
+    if (cond.bad()) {
+      LOGW("Save {} failed:{}", path, err_msg(cond));
+    }
+  }
+  LOGI("Saved {} response(s) of request {}", responses.size(), request + 1);
+}
+
+int main(int argc, char **argv) {
+  cxxopts::Options options("FindScu", "Find Scu");
+  peer::add_options(options, "localhost", 4243, "ANY-SCP");
+
+  // clang-format off
+  options.add_options()
+  ("h,help", "Print usage");
+  // clang-format on
+  cxxopts::ParseResult args;
+  try {
+    args = options.parse(argc, argv);
+    if (args.count("help")) {
+      fmt::print(options.help());
+      return EXIT_SUCCESS;
+    }
+  } catch (const cxxopts::OptionException &e) {
+    fmt::print(options.help());
+    return EXIT_SUCCESS;
+  }
+
+  // 1. initialize underline network
+  OFStandard::initializeNetwork();
+  const auto timeouts = peer::timeouts_from_args(args);
+  peer::apply(timeouts);
+
+  // C-FIND is idempotent, hedge it
+  auto failed = 0;
+  {
+    peer::Group group(peer::peers_from_args(args), peer::options_from_args(args));
+    const auto repeat = args["repeat"].as<int>();
+    for (auto i = 0; i < repeat; ++i) {
+      const auto result = group.Run([timeouts](const peer::Peer &peer) { return find(peer, timeouts); }, true);
+      if (result.cond.bad()) {
+        ++failed;
+        continue;
+      }
+      save(std::any_cast<const Responses &>(result.data), i);
+    }
+    group.Wait();
+    group.Report();
+  }
+
   OFStandard::shutdownNetwork();
 
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
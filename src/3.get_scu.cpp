@@ -1,23 +1,29 @@
+#include "cxxopts.hpp"
 #include "dcmtk/dcmdata/dcuid.h"
 #include "dcmtk/dcmnet/assoc.h"
 #include "dcmtk/dcmnet/cond.h"
 #include "dcmtk/dcmnet/dimse.h"
 #include "dcmtk/dcmnet/scu.h"
 #include "dcmtk/ofstd/oflist.h"
+#include "dcmtk/ofstd/ofstd.h"
 #include "dcmtk/ofstd/ofstring.h"
 #include "dcmtk/ofstd/oftypes.h"
 #include "log.hpp"
+#include "peer_group.hpp"
 
-int main(int argc, char** argv) {
+/**
+ * @brief one C-GET, only failed over to another peer when the association can not be established
+ */
+peer::Result get(const peer::Peer& peer, const peer::Timeouts& timeouts) {
   DcmSCU scu;
   scu.setMaxReceivePDULength(ASC_DEFAULTMAXPDU);
-  scu.setACSETimeout(10);
+  scu.setACSETimeout(timeouts.acse);
   scu.setDIMSEBlockingMode(DIMSE_NONBLOCKING);
-  scu.setDIMSETimeout(10);
+  scu.setDIMSETimeout(timeouts.dimse);
   scu.setAETitle("GETSCU");
-  scu.setPeerHostName("localhost");
-  scu.setPeerPort(4243);
-  scu.setPeerAETitle("ANY_SCP");
+  scu.setPeerHostName(peer.host.c_str());
+  scu.setPeerPort(peer.port);
+  scu.setPeerAETitle(peer.title.c_str());
   scu.setVerbosePCMode(OFTrue);
 
   OFList<OFString> syntaxes;
@@ -37,19 +43,20 @@ int main(int argc, char** argv) {
   OFString error;
   if (cond.bad()) {
     LOGE("Initialize network failed:{}\n", DimseCondition::dump(error, cond));
-    exit(EXIT_FAILURE);
+    return {cond};
   }
 
   cond = scu.negotiateAssociation();
   if (cond.bad()) {
     LOGE("Negotiate association failed:{}\n", DimseCondition::dump(error, cond));
-    exit(EXIT_FAILURE);
+    return {cond};
   }
 
   auto presentation_ctx_id = scu.findPresentationContextID(UID_GETStudyRootQueryRetrieveInformationModel, "");
   if (presentation_ctx_id == 0) {
     LOGE("No adequate presentation context for sending C_GET");
-    exit(EXIT_FAILURE);
+    scu.releaseAssociation();
+    return {NET_EC_NoAcceptablePresentationContexts};
   }
 
   DcmFileFormat file_format;
@@ -60,7 +67,6 @@ int main(int argc, char** argv) {
   cond = scu.sendCGETRequest(presentation_ctx_id, data_set, &responses);
   if (cond.bad()) {
     LOGE("Send C-Get failed:{}\n", DimseCondition::dump(error, cond));
-    exit(EXIT_FAILURE);
   }
 
   if (!responses.empty()) {
@@ -76,15 +82,54 @@ int main(int argc, char** argv) {
     scu.releaseAssociation();
   } else if (cond == DUL_PEERREQUESTEDRELEASE) {
     scu.closeAssociation(DCMSCU_PEER_REQUESTED_RELEASE);
-    return EXIT_FAILURE;
   } else if (cond == DUL_PEERABORTEDASSOCIATION) {
     scu.closeAssociation(DCMSCU_PEER_ABORTED_ASSOCIATION);
-    return EXIT_FAILURE;
   } else {
     LOGE("Get SCU failed:{}", DimseCondition::dump(error, cond));
-    return EXIT_FAILURE;
     scu.abortAssociation();
   }
 
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  return {cond, true};
+}
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("GetScu", "Get Scu");
+  peer::add_options(options, "localhost", 4243);
+
+  // clang-format off
+  options.add_options()
+  ("h,help", "Print usage");
+  // clang-format on
+  cxxopts::ParseResult args;
+  try {
+    args = options.parse(argc, argv);
+    if (args.count("help")) {
+      fmt::print(options.help());
+      return EXIT_SUCCESS;
+    }
+  } catch (const cxxopts::OptionException& e) {
+    fmt::print(options.help());
+    return EXIT_SUCCESS;
+  }
+
+  OFStandard::initializeNetwork();
+  const auto timeouts = peer::timeouts_from_args(args);
+  peer::apply(timeouts);
+
+  // C-GET stores files and is not hedged, it only fails over before the association is established
+  auto failed = 0;
+  {
+    peer::Group group(peer::peers_from_args(args), peer::options_from_args(args));
+    const auto repeat = args["repeat"].as<int>();
+    for (auto i = 0; i < repeat; ++i) {
+      if (group.Run([timeouts](const peer::Peer& peer) { return get(peer, timeouts); }, false).cond.bad()) {
+        ++failed;
+      }
+    }
+    group.Report();
+  }
+
+  OFStandard::shutdownNetwork();
+
+  return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
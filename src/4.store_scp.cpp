@@ -1,11 +1,16 @@
 #include <array>
+#include <chrono>
 #include <cstdlib>
 #include <iostream>
+#include <random>
+#include <string>
 #include <string_view>
+#include <thread>
 
 #include "cxxopts.hpp"
 #include "dcmtk/dcmdata/dcdatset.h"
 #include "dcmtk/dcmdata/dcdict.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
 #include "dcmtk/dcmdata/dcobject.h"
 #include "dcmtk/dcmdata/dcuid.h"
 #include "dcmtk/dcmnet/assoc.h"
@@ -18,11 +23,76 @@
 #include "dcmtk/ofstd/ofstd.h"
 #include "dcmtk/ofstd/ofstring.h"
 #include "dcmtk/ofstd/oftypes.h"
+#include "byte_swap.hpp"
 #include "log.hpp"
 #include "tls_helper.hpp"
 #include "utility.hpp"
 
-OFCondition process(T_ASC_Association* assoc) {
+/**
+ * @brief artificial latency before responses, lets this SCP stand in for a slow PACS node
+ *
+ * Only a ratio of the responses is delayed, which gives the long tail a real PACS node shows under load.
+ */
+class Delay {
+ public:
+  Delay(std::chrono::milliseconds delay, double ratio) : delay_(delay), ratio_(ratio) {}
+
+  void operator()() {
+    if (delay_.count() > 0 && distribution_(engine_) < ratio_) {
+      std::this_thread::sleep_for(delay_);
+    }
+  }
+
+ private:
+  std::chrono::milliseconds delay_;
+  double ratio_;
+  std::mt19937 engine_{std::random_device{}()};
+  std::uniform_real_distribution<double> distribution_;
+};
+
+struct StoreContext {
+  DcmFileFormat* file_format = nullptr;
+  std::string path;
+};
+
+void store_callback(void* data, T_DIMSE_StoreProgress* progress, T_DIMSE_C_StoreRQ* req, char* image_file_name,
+                    DcmDataset** dataset, T_DIMSE_C_StoreRSP* rsp, DcmDataset** status_detail) {
+  if (progress->state != DIMSE_StoreEnd || rsp->DimseStatus != STATUS_Success || !dataset || !*dataset) {
+    return;
+  }
+
+  const auto* context = static_cast<StoreContext*>(data);
+  spdlog::stopwatch watch;
+  // swap Big Endian pixel data with the vectorized kernel, DCMTK swaps the remaining small elements when saving
+  auto cond = byte_swap::pixel_data_to_local_byte_order(*dataset);
+  if (cond.good()) {
+    cond = context->file_format->saveFile(context->path.c_str(), EXS_LittleEndianExplicit);
+  }
+  if (cond.bad()) {
+    LOGW("Save {} failed:{}", context->path, err_msg(cond));
+    rsp->DimseStatus = STATUS_STORE_Refused_OutOfResources;
+    return;
+  }
+  LOGI("Saved {} as Little Endian Explicit in {:.3}s, byte swap kernel:{}", context->path, watch,
+       byte_swap::name(byte_swap::best()));
+}
+
+OFCondition store(T_ASC_Association* assoc, T_ASC_PresentationContextID presentation_cxt_id, T_DIMSE_C_StoreRQ* req,
+                  const std::string& output_dir) {
+  DcmFileFormat file_format;
+  auto* dataset = file_format.getDataset();
+  StoreContext context{&file_format, fmt::format("{}/{}.dcm", output_dir, req->AffectedSOPInstanceUID)};
+  return DIMSE_storeProvider(assoc, presentation_cxt_id, req, nullptr, OFTrue, &dataset, store_callback, &context,
+                             DIMSE_BLOCKING, 0);
+}
+
+/**
+ * @brief serve DIMSE commands until the peer releases or aborts
+ *
+ * @param delay       artificial latency before responses
+ * @param output_dir  directory received objects are saved to
+ */
+OFCondition process(T_ASC_Association* assoc, Delay& delay, const std::string& output_dir) {
   OFCondition cond = EC_Normal;
   T_DIMSE_Message msg;
   T_ASC_PresentationContextID presentation_cxt_id = 0;
@@ -40,9 +110,19 @@ OFCondition process(T_ASC_Association* assoc) {
       switch (msg.CommandField) {
         case DIMSE_C_ECHO_RQ:
           LOGI("Received DIMSE_C_ECHO_RQ");
+          delay();
+          cond = DIMSE_sendEchoResponse(assoc, presentation_cxt_id, &msg.msg.CEchoRQ, STATUS_Success, nullptr);
+          if (cond.bad()) {
+            LOGW("Send echo response failed:{}", err_msg(cond));
+          }
           break;
         case DIMSE_C_STORE_RQ:
           LOGI("Received DIMSE_C_STORE_RQ");
+          delay();
+          cond = store(assoc, presentation_cxt_id, &msg.msg.CStoreRQ, output_dir);
+          if (cond.bad()) {
+            LOGW("Store failed:{}", err_msg(cond));
+          }
           break;
         default:
           OFString tmp;
@@ -54,15 +134,24 @@ OFCondition process(T_ASC_Association* assoc) {
   return cond;
 }
 
-OFCondition accept_association(T_ASC_Network* net, DcmAssociationConfiguration& asc_config, OFBool secure_connection) {
+OFCondition accept_association(T_ASC_Network* net, DcmAssociationConfiguration& asc_config, OFBool secure_connection,
+                               Delay& delay, const std::string& output_dir) {
   const char* known_abstract_syntaxes[1] = {UID_VerificationSOPClass};
   const char* transfer_syntaxes[21] = {};
 
   T_ASC_Association* assoc = nullptr;
+  // a failed association(e.g. a client that timed out and closed its socket) is dropped and the next one accepted,
+  // only network level errors stop the server
+  auto drop = [&assoc](const OFCondition& cond) {
+    ASC_dropSCPAssociation(assoc);
+    ASC_destroyAssociation(&assoc);
+    return cond == DUL_NETWORKCLOSED || cond == DUL_TCPINITERROR ? cond : EC_Normal;
+  };
+
   auto cond = ASC_receiveAssociation(net, &assoc, ASC_DEFAULTMAXPDU, nullptr, nullptr, secure_connection);
   if (cond.bad()) {
     LOGW("Association received failed:{}", err_msg(cond));
-    return cond;
+    return drop(cond);
   }
   LOGI("Association received");
 
@@ -76,7 +165,7 @@ OFCondition accept_association(T_ASC_Network* net, DcmAssociationConfiguration&
                                                          num_transfer_syntaxes);
   if (cond.bad()) {
     LOGW("ASC_acceptContextsWithPreferredTransferSyntaxes failed: {}", err_msg(cond));
-    return cond;
+    return drop(cond);
   }
 
   cond = ASC_acceptContextsWithPreferredTransferSyntaxes(assoc->params, dcmAllStorageSOPClassUIDs,
@@ -84,7 +173,7 @@ OFCondition accept_association(T_ASC_Network* net, DcmAssociationConfiguration&
                                                          num_transfer_syntaxes);
   if (cond.bad()) {
     LOGW("ASC_acceptContextsWithPreferredTransferSyntaxes failed: {}", err_msg(cond));
-    return cond;
+    return drop(cond);
   }
 
   ASC_setAPTitles(assoc->params, nullptr, nullptr, FILE_NAME);
@@ -100,13 +189,13 @@ OFCondition accept_association(T_ASC_Network* net, DcmAssociationConfiguration&
       LOGW("Association reject faild:{}", err_msg(cond));
     }
 
-    return cond;
+    return drop(cond);
   }
 
   cond = ASC_acknowledgeAssociation(assoc);
   if (cond.bad()) {
     LOGW("ASC_acknowledgeAssociation faild:{}", err_msg(cond));
-    return cond;
+    return drop(cond);
   }
   LOGI("Association acknowledged");
 
@@ -123,7 +212,22 @@ OFCondition accept_association(T_ASC_Network* net, DcmAssociationConfiguration&
           .good()) {
   }
 
-  return process(assoc);
+  cond = process(assoc, delay, output_dir);
+  if (cond == DUL_PEERREQUESTEDRELEASE) {
+    LOGI("Association released");
+    cond = ASC_acknowledgeRelease(assoc);
+  } else if (cond == DUL_PEERABORTEDASSOCIATION) {
+    LOGI("Association aborted");
+    cond = EC_Normal;
+  } else {
+    LOGW("DIMSE failure, aborting association:{}", err_msg(cond));
+    cond = ASC_abortAssociation(assoc);
+  }
+
+  if (cond.bad()) {
+    LOGW("Close association failed:{}", err_msg(cond));
+  }
+  return drop(cond);
 }
 
 int main(int argc, char** argv) {
@@ -132,6 +236,9 @@ int main(int argc, char** argv) {
   // default dicom port of orthanc
   options.add_options()
   ("p,port", "tcp/ip port to listen on", cxxopts::value<int>()->default_value("4646"))
+  ("d,delay", "delay in milliseconds before a response, simulates a slow peer", cxxopts::value<int>()->default_value("0"))
+  ("delay-ratio", "ratio of responses that are delayed", cxxopts::value<double>()->default_value("1"))
+  ("o,output", "directory to save received objects to", cxxopts::value<std::string>()->default_value("."))
   ("h,help", "Print usage");
   // clang-format on
   cxxopts::ParseResult args;
@@ -181,9 +288,13 @@ int main(int argc, char** argv) {
 
   DcmAssociationConfiguration asc_config;
 
+  Delay delay(std::chrono::milliseconds(args["delay"].as<int>()), args["delay-ratio"].as<double>());
+  const auto output_dir = args["output"].as<std::string>();
   while (cond.good()) {
-    cond = accept_association(asc_net, asc_config, OFTrue);
-    LOGE("Accept failed:{}", err_msg(cond));
+    cond = accept_association(asc_net, asc_config, OFTrue, delay, output_dir);
+    if (cond.bad()) {
+      LOGE("Accept failed:{}", err_msg(cond));
+    }
   }
 
   cond = ASC_dropNetwork(&asc_net);
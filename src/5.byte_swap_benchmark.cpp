@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "byte_swap.hpp"
+#include "cxxopts.hpp"
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmtk/dcmdata/dcpixel.h"
+#include "dcmtk/dcmdata/dcswap.h"
+#include "dcmtk/dcmdata/dcuid.h"
+#include "log.hpp"
+#include "utility.hpp"
+
+namespace {
+
+using Millis = std::chrono::duration<double, std::milli>;
+
+constexpr auto big_endian_path = "byte_swap_benchmark_be.dcm";
+constexpr auto little_endian_path = "byte_swap_benchmark_le.dcm";
+
+/**
+ * @brief median time of swapping words in place iterations times
+ */
+template <typename Swap>
+auto measure(std::vector<Uint16>& words, int iterations, Swap&& swap) {
+  std::vector<double> times;
+  for (auto i = 0; i < iterations; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    swap(words.data(), words.size());
+    times.push_back(Millis(std::chrono::steady_clock::now() - start).count());
+  }
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+/**
+ * @brief median time of converting the Big Endian object to a Little Endian file, decoding it is not timed
+ *
+ * @return negative if any iteration failed
+ */
+template <typename Convert>
+auto measure_store(int iterations, Convert&& convert) {
+  std::vector<double> times;
+  for (auto i = 0; i < iterations; ++i) {
+    DcmFileFormat file_format;
+    auto cond = file_format.loadFile(big_endian_path);
+    if (cond.good()) {
+      cond = file_format.loadAllDataIntoMemory();
+    }
+    if (cond.bad()) {
+      LOGE("Load {} failed:{}", big_endian_path, err_msg(cond));
+      return -1.0;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    cond = convert(file_format);
+    times.push_back(Millis(std::chrono::steady_clock::now() - start).count());
+    if (cond.bad()) {
+      LOGE("Convert failed:{}", err_msg(cond));
+      return -1.0;
+    }
+  }
+  std::sort(times.begin(), times.end());
+  return times[times.size() / 2];
+}
+
+void report(std::string_view kernel, double ms, std::size_t bytes, double baseline_ms) {
+  LOGI("  {:<12} {:>10.3f}ms {:>8.2f}GB/s {:>6.2f}x", kernel, ms, bytes / ms / 1e6, baseline_ms / ms);
+}
+
+/**
+ * @brief save a MONOCHROME2 object with the given pixels as Big Endian Explicit
+ */
+auto write_big_endian(const std::vector<Uint16>& pixels, int rows, int columns, int frames) {
+  DcmFileFormat file_format;
+  auto* dataset = file_format.getDataset();
+  char uid[100];
+  dataset->putAndInsertString(DCM_SOPClassUID, UID_MultiframeGrayscaleWordSecondaryCaptureImageStorage);
+  dataset->putAndInsertString(DCM_SOPInstanceUID, dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT));
+  dataset->putAndInsertUint16(DCM_SamplesPerPixel, 1);
+  dataset->putAndInsertString(DCM_PhotometricInterpretation, "MONOCHROME2");
+  dataset->putAndInsertUint16(DCM_Rows, static_cast<Uint16>(rows));
+  dataset->putAndInsertUint16(DCM_Columns, static_cast<Uint16>(columns));
+  dataset->putAndInsertString(DCM_NumberOfFrames, std::to_string(frames).c_str());
+  dataset->putAndInsertUint16(DCM_BitsAllocated, 16);
+  dataset->putAndInsertUint16(DCM_BitsStored, 16);
+  dataset->putAndInsertUint16(DCM_HighBit, 15);
+  dataset->putAndInsertUint16(DCM_PixelRepresentation, 0);
+
+  auto* pixel_data = new DcmPixelData(DCM_PixelData);
+  pixel_data->setVR(EVR_OW);
+  pixel_data->putUint16Array(pixels.data(), static_cast<unsigned long>(pixels.size()));
+  dataset->insert(pixel_data, OFTrue);
+
+  return file_format.saveFile(big_endian_path, EXS_BigEndianExplicit);
+}
+
+/**
+ * @brief check the Little Endian file holds the original pixels
+ */
+auto verify_little_endian(const std::vector<Uint16>& pixels) {
+  DcmFileFormat file_format;
+  const Uint16* words = nullptr;
+  unsigned long count = 0;
+  if (file_format.loadFile(little_endian_path).bad() ||
+      file_format.getDataset()->findAndGetUint16Array(DCM_PixelData, words, &count).bad() || count != pixels.size()) {
+    return false;
+  }
+  return std::equal(pixels.begin(), pixels.end(), words);
+}
+
+/**
+ * @brief compare every kernel with DCMTK's swapBytes, then the store_scp path with a plain DCMTK save
+ */
+auto run(int rows, int columns, int frames, int iterations, int store_iterations) {
+  const auto count = static_cast<std::size_t>(rows) * columns * frames;
+  const auto bytes = count * sizeof(Uint16);
+  LOGI("{}x{}x16bit, {} frame(s), {:.1f}MB, median of {} iterations", rows, columns, frames, bytes / 1e6, iterations);
+
+  std::vector<Uint16> source(count);
+  std::mt19937 rng(count);
+  std::generate(source.begin(), source.end(), [&rng] { return static_cast<Uint16>(rng()); });
+
+  std::vector<Uint16> expected(source);
+  byte_swap::swap16(source.data(), expected.data(), count, byte_swap::Kernel::kScalar);
+
+  // the scalar path of DCMTK, used when a Big Endian dataset is accessed or written as Little Endian
+  auto words = source;
+  const auto dcmtk_ms = measure(words, iterations, [](Uint16* data, std::size_t size) {
+    swapBytes(data, static_cast<Uint32>(size * sizeof(Uint16)), sizeof(Uint16));
+  });
+  report("DCMTK", dcmtk_ms, bytes, dcmtk_ms);
+
+  auto ok = true;
+  for (const auto kernel : byte_swap::supported()) {
+    words = source;
+    const auto ms = measure(words, iterations, [kernel](Uint16* data, std::size_t size) {
+      byte_swap::swap16(data, data, size, kernel);
+    });
+    report(byte_swap::name(kernel), ms, bytes, dcmtk_ms);
+
+    // every iteration swaps again, an odd count leaves the words swapped
+    if (words != (iterations % 2 ? expected : source)) {
+      LOGE("{} kernel produced wrong result", byte_swap::name(kernel));
+      ok = false;
+    }
+  }
+
+  // what store_scp does with a Big Endian object: decode it, then save it as Little Endian
+  auto cond = write_big_endian(source, rows, columns, frames);
+  if (cond.bad()) {
+    LOGE("Save {} failed:{}", big_endian_path, err_msg(cond));
+    return false;
+  }
+  LOGI("Big Endian object saved as Little Endian Explicit, median of {} iterations", store_iterations);
+
+  const auto save_ms = measure_store(store_iterations, [](DcmFileFormat& file_format) {
+    return file_format.saveFile(little_endian_path, EXS_LittleEndianExplicit);
+  });
+  report("DCMTK save", save_ms, bytes, save_ms);
+
+  const auto swap_save_ms = measure_store(store_iterations, [](DcmFileFormat& file_format) {
+    auto cond = byte_swap::pixel_data_to_local_byte_order(file_format.getDataset());
+    return cond.good() ? file_format.saveFile(little_endian_path, EXS_LittleEndianExplicit) : cond;
+  });
+  report(fmt::format("{}+save", byte_swap::name(byte_swap::best())), swap_save_ms, bytes, save_ms);
+
+  if (save_ms < 0 || swap_save_ms < 0 || !verify_little_endian(source)) {
+    LOGE("store_scp path produced wrong result");
+    ok = false;
+  }
+
+  std::remove(big_endian_path);
+  std::remove(little_endian_path);
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cxxopts::Options options("ByteSwapBenchmark", "Benchmark 16 bit byte swap kernels against DCMTK");
+  // clang-format off
+  options.add_options()
+  ("f,frames", "frames of the multi-frame object", cxxopts::value<int>()->default_value("200"))
+  ("i,iterations", "iterations per kernel", cxxopts::value<int>()->default_value("21"))
+  ("s,store-iterations", "iterations of the store_scp path, each saves a file", cxxopts::value<int>()->default_value("5"))
+  ("h,help", "Print usage");
+  // clang-format on
+  cxxopts::ParseResult args;
+  try {
+    args = options.parse(argc, argv);
+    if (args.count("help")) {
+      fmt::print(options.help());
+      return EXIT_SUCCESS;
+    }
+  } catch (const cxxopts::OptionException& e) {
+    fmt::print(options.help());
+    return EXIT_SUCCESS;
+  }
+
+  const auto iterations = std::max(1, args["iterations"].as<int>());
+  const auto store_iterations = std::max(1, args["store-iterations"].as<int>());
+  LOGI("Best byte swap kernel:{}", byte_swap::name(byte_swap::best()));
+
+  // a typical CT/MR slice and a large multi-frame object
+  auto ok = run(512, 512, 1, iterations, store_iterations);
+  ok = run(512, 512, std::max(1, args["frames"].as<int>()), iterations, store_iterations) && ok;
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,254 @@
+#pragma once
+
+/**
+ * @file byte_swap.hpp
+ * @brief   16 bit byte swap kernels(scalar, SSE2, AVX2, NEON) with runtime cpu dispatch
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * DICOM OW values in Big Endian Explicit are stored as big endian 16 bit words, converting them to little endian is a
+ * swap of every word. DCMTK does it one word at a time, these kernels do it a vector at a time.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "dcmtk/dcmdata/dcdatset.h"
+#include "dcmtk/dcmdata/dcdeftag.h"
+#include "dcmtk/dcmdata/dcelem.h"
+#include "dcmtk/ofstd/ofcond.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BYTE_SWAP_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define BYTE_SWAP_NEON
+#include <arm_neon.h>
+#endif
+
+// msvc emits SSE2 and AVX2 intrinsics without special flags, gcc and clang need the target per function(32 bit x86
+// does not enable SSE2 by default)
+#if defined(BYTE_SWAP_X86) && !defined(_MSC_VER)
+#define BYTE_SWAP_TARGET_SSE2 __attribute__((target("sse2")))
+#define BYTE_SWAP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define BYTE_SWAP_TARGET_SSE2
+#define BYTE_SWAP_TARGET_AVX2
+#endif
+
+namespace byte_swap {
+
+enum class Kernel { kScalar, kSse2, kAvx2, kNeon };
+
+inline auto name(Kernel kernel) -> std::string_view {
+  switch (kernel) {
+    case Kernel::kSse2:
+      return "SSE2";
+    case Kernel::kAvx2:
+      return "AVX2";
+    case Kernel::kNeon:
+      return "NEON";
+    default:
+      return "scalar";
+  }
+}
+
+namespace details {
+
+// src and dst may be the same buffer, every kernel loads a block before storing it
+
+inline void swap16_scalar(const std::uint16_t* src, std::uint16_t* dst, std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    dst[i] = static_cast<std::uint16_t>((src[i] << 8) | (src[i] >> 8));
+  }
+}
+
+#ifdef BYTE_SWAP_X86
+BYTE_SWAP_TARGET_SSE2 inline void swap16_sse2(const std::uint16_t* src, std::uint16_t* dst, std::size_t count) {
+  // no pshufb before SSSE3, swap with shifts
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 8),
+                     _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8)));
+  }
+  swap16_scalar(src + i, dst + i, count - i);
+}
+
+BYTE_SWAP_TARGET_AVX2 inline void swap16_avx2(const std::uint16_t* src, std::uint16_t* dst, std::size_t count) {
+  const auto mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,  //
+                                     1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  std::size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    const auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    const auto b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(a, mask));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 16), _mm256_shuffle_epi8(b, mask));
+  }
+  swap16_scalar(src + i, dst + i, count - i);
+}
+
+inline auto has_avx2() -> bool {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  const auto osxsave = (info[2] & (1 << 27)) != 0;
+  const auto avx = (info[2] & (1 << 28)) != 0;
+  // the os must save ymm registers on context switch
+  if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+inline auto has_sse2() -> bool {
+#if defined(__x86_64__) || defined(_M_X64)
+  return true;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+#else
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+#endif
+
+#ifdef BYTE_SWAP_NEON
+inline void swap16_neon(const std::uint16_t* src, std::uint16_t* dst, std::size_t count) {
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const auto a = vld1q_u8(reinterpret_cast<const std::uint8_t*>(src + i));
+    const auto b = vld1q_u8(reinterpret_cast<const std::uint8_t*>(src + i + 8));
+    vst1q_u8(reinterpret_cast<std::uint8_t*>(dst + i), vrev16q_u8(a));
+    vst1q_u8(reinterpret_cast<std::uint8_t*>(dst + i + 8), vrev16q_u8(b));
+  }
+  swap16_scalar(src + i, dst + i, count - i);
+}
+#endif
+
+}  // namespace details
+
+/**
+ * @brief kernels this cpu can run, scalar first and best last
+ */
+inline auto supported() -> std::vector<Kernel> {
+  std::vector<Kernel> kernels{Kernel::kScalar};
+#ifdef BYTE_SWAP_X86
+  if (details::has_sse2()) {
+    kernels.push_back(Kernel::kSse2);
+  }
+  if (details::has_avx2()) {
+    kernels.push_back(Kernel::kAvx2);
+  }
+#endif
+#ifdef BYTE_SWAP_NEON
+  kernels.push_back(Kernel::kNeon);
+#endif
+  return kernels;
+}
+
+/**
+ * @brief best kernel of this cpu, detected once
+ */
+inline auto best() -> Kernel {
+  static const auto kernel = supported().back();
+  return kernel;
+}
+
+/**
+ * @brief swap the bytes of count 16 bit words from src to dst, src and dst may be the same buffer
+ */
+inline void swap16(const std::uint16_t* src, std::uint16_t* dst, std::size_t count, Kernel kernel = best()) {
+  switch (kernel) {
+#ifdef BYTE_SWAP_X86
+    case Kernel::kSse2:
+      details::swap16_sse2(src, dst, count);
+      return;
+    case Kernel::kAvx2:
+      details::swap16_avx2(src, dst, count);
+      return;
+#endif
+#ifdef BYTE_SWAP_NEON
+    case Kernel::kNeon:
+      details::swap16_neon(src, dst, count);
+      return;
+#endif
+    default:
+      details::swap16_scalar(src, dst, count);
+  }
+}
+
+namespace details {
+
+/**
+ * @brief reach the protected value field of an element
+ *
+ * DCMTK has no public call that hands out OW values without first swapping them to the local byte order. A member
+ * pointer named through a derived class can be applied to any DcmElement.
+ */
+struct ElementAccess : DcmElement {
+  static auto value(DcmElement* element, E_ByteOrder byte_order) -> void* {
+    void* (DcmElement::*get_value)(const E_ByteOrder) = &ElementAccess::getValue;
+    return (element->*get_value)(byte_order);
+  }
+
+  static auto byte_order(const DcmElement* element) -> E_ByteOrder {
+    E_ByteOrder (DcmElement::*get_byte_order)() const = &ElementAccess::getByteOrder;
+    return (element->*get_byte_order)();
+  }
+
+  static void set_byte_order(DcmElement* element, E_ByteOrder byte_order) {
+    void (DcmElement::*set)(E_ByteOrder) = &ElementAccess::setByteOrder;
+    (element->*set)(byte_order);
+  }
+};
+
+}  // namespace details
+
+/**
+ * @brief convert OW pixel data still in big endian, as read from Big Endian Explicit, to the local byte order
+ *
+ * DCMTK keeps values in the byte order they were received in and swaps them in place word by word when they are
+ * accessed or written. This swaps the same buffer in place with the best kernel instead, so writing the dataset as
+ * Little Endian leaves pixel data alone. No copy and no extra allocation is made.
+ */
+inline auto pixel_data_to_local_byte_order(DcmDataset* dataset) -> OFCondition {
+  if (gLocalByteOrder != EBO_LittleEndian) {
+    return EC_Normal;
+  }
+
+  DcmElement* element = nullptr;
+  if (dataset->findAndGetElement(DCM_PixelData, element).bad() || element->getVR() != EVR_OW ||
+      details::ElementAccess::byte_order(element) != EBO_BigEndian) {
+    // OB pixel data is a byte stream and has nothing to swap
+    return EC_Normal;
+  }
+
+  // loads the value if needed but does not swap it
+  auto* words = static_cast<Uint16*>(details::ElementAccess::value(element, EBO_BigEndian));
+  if (!words) {
+    return element->error();
+  }
+
+  swap16(words, words, element->getLength() / sizeof(Uint16));
+  details::ElementAccess::set_byte_order(element, gLocalByteOrder);
+  return EC_Normal;
+}
+
+}  // namespace byte_swap
@@ -0,0 +1,475 @@
+#pragma once
+
+/**
+ * @file peer_group.hpp
+ * @brief   replicated DICOM peers with load balancing, failover and hedged requests
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * Requests go to the peer with the lowest cost, the cost grows with outstanding requests and observed latency and
+ * shrinks with health. Idempotent requests(C-ECHO, C-FIND) are hedged to a second peer when the first one has not
+ * answered within an adaptive delay(a high quantile of recent latencies). Failed attempts fail over to the next peer.
+ */
+
+#include <algorithm>
+#include <any>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "cxxopts.hpp"
+#include "dcmtk/dcmnet/dcmtrans.h"
+#include "dcmtk/ofstd/ofcond.h"
+#include "log.hpp"
+#include "utility.hpp"
+
+namespace peer {
+
+using Clock = std::chrono::steady_clock;
+using Millis = std::chrono::duration<double, std::milli>;
+
+struct Peer {
+  std::string host;
+  int port = 0;
+  std::string title;
+};
+
+inline auto describe(const Peer& peer) {
+  return fmt::format("{}@{}:{}", peer.title, peer.host, peer.port);
+}
+
+/**
+ * @brief outcome of one attempt
+ *
+ * associated is true once the association is established, a non-idempotent request is only failed over before that.
+ * data is what the attempt received, only the winner's reaches the caller.
+ */
+struct Result {
+  OFCondition cond = EC_IllegalCall;
+  bool associated = false;
+  std::any data;
+};
+
+using Operation = std::function<Result(const Peer&)>;
+
+/**
+ * @brief timeouts in seconds, short so a stuck peer fails over quickly
+ */
+struct Timeouts {
+  int connect = 3;  // TCP connect
+  int acse = 3;     // association request and release
+  int dimse = 5;    // each DIMSE message
+};
+
+/**
+ * @brief set the process wide DCMTK timeouts, socket timeouts must not cut an ACSE or DIMSE wait short
+ */
+inline void apply(const Timeouts& timeouts) {
+  dcmConnectionTimeout.set(timeouts.connect);
+  const auto socket = std::max(timeouts.acse, timeouts.dimse);
+  dcmSocketSendTimeout.set(socket);
+  dcmSocketReceiveTimeout.set(socket);
+}
+
+struct Options {
+  bool hedge = true;
+  double hedge_quantile = 0.95;                // hedge after this quantile of recent latencies
+  Millis initial_hedge_delay{100};             // used until enough latencies are observed
+  Millis min_hedge_delay{2};                   // never hedge earlier than this
+  std::chrono::milliseconds recovery{10'000};  // time for a failed peer to regain most of its health
+  std::chrono::milliseconds forget{5'000};     // time for the latency of an idle peer to fade out
+  double min_health = 0.5;                     // peers below this are only tried when no healthy peer is left
+  std::size_t window = 256;                    // latencies kept for the hedge delay
+};
+
+/**
+ * @brief nearest-rank quantile of sorted values
+ */
+inline auto quantile(const std::vector<double>& sorted, double q) {
+  if (sorted.empty()) {
+    return 0.0;
+  }
+  const auto rank = static_cast<std::size_t>(std::ceil(q * sorted.size()));
+  return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+class Group {
+ public:
+  Group(std::vector<Peer> peers, Options options)
+      : peers_(std::move(peers)), stats_(peers_.size()), options_(std::move(options)) {
+    for (const auto& peer : peers_) {
+      LOGI("Peer {}", describe(peer));
+    }
+  }
+
+  Group(const Group&) = delete;
+  Group(Group&&) = delete;
+  auto operator=(const Group&) -> Group& = delete;
+  auto operator=(Group&&) -> Group& = delete;
+
+  ~Group() { Wait(); }
+
+  /**
+   * @brief run op on the best peer, hedging and failing over as needed
+   *
+   * @param op          one attempt against one peer, may run on another thread
+   * @param idempotent  whether op may be hedged or retried after the association is established
+   * @return Result     result of the first successful attempt, or the last failure
+   */
+  auto Run(const Operation& op, bool idempotent) -> Result {
+    auto race = std::make_shared<Race>();
+    std::vector<bool> tried(peers_.size(), false);
+    const auto hedge_delay = std::chrono::duration_cast<Clock::duration>(HedgeDelay());
+    const auto start = Clock::now();
+    auto hedged = !(idempotent && options_.hedge);
+    auto deadline = start + hedge_delay;
+    std::optional<std::size_t> first;
+    std::optional<std::size_t> hedge;
+    auto settled = [&race] { return race->winner.has_value() || race->pending == 0; };
+
+    std::unique_lock lock(race->mutex);
+    while (!race->winner) {
+      if (race->pending == 0) {
+        // nothing in flight, either the first attempt or every attempt failed
+        if (first && !idempotent && race->result.associated) {
+          break;
+        }
+        auto next = Pick(tried);
+        if (!next) {
+          break;
+        }
+        if (first) {
+          LOGW("Fail over to {}:{}", describe(peers_[*next]), err_msg(race->result.cond));
+          std::lock_guard guard(mutex_);
+          ++failovers_;
+        } else {
+          first = next;
+        }
+        Launch(*next, op, race);
+        deadline = Clock::now() + hedge_delay;
+      } else if (!hedged) {
+        if (race->cv.wait_until(lock, deadline, settled)) {
+          continue;
+        }
+        hedged = true;
+        hedge = Pick(tried);
+        if (hedge) {
+          LOGD("No response after {:.2f}ms, hedge to {}", Millis(hedge_delay).count(), describe(peers_[*hedge]));
+          {
+            std::lock_guard guard(mutex_);
+            ++hedges_;
+          }
+          Launch(*hedge, op, race);
+        }
+      } else {
+        race->cv.wait(lock, settled);
+      }
+    }
+
+    const auto result = race->result;
+    const auto winner = race->winner;
+    lock.unlock();
+
+    const Millis elapsed = Clock::now() - start;
+    std::lock_guard guard(mutex_);
+    latencies_.push_back(elapsed.count());
+    if (!winner) {
+      ++failures_;
+    } else if (winner == hedge) {
+      ++hedge_wins_;
+    }
+    return result;
+  }
+
+  /**
+   * @brief wait for attempts that lost a race and are still running
+   */
+  void Wait() {
+    std::vector<std::future<void>> stragglers;
+    {
+      std::lock_guard guard(mutex_);
+      stragglers.swap(stragglers_);
+    }
+    for (auto& straggler : stragglers) {
+      straggler.wait();
+    }
+  }
+
+  /**
+   * @brief log request latency distribution and per peer statistics
+   */
+  void Report() const {
+    std::lock_guard guard(mutex_);
+    if (latencies_.empty()) {
+      return;
+    }
+
+    auto sorted = latencies_;
+    std::sort(sorted.begin(), sorted.end());
+    LOGI("{} requests, {} failed, {} hedged({} won by hedge), {} failovers", sorted.size(), failures_, hedges_,
+         hedge_wins_, failovers_);
+    LOGI("Latency(ms) min:{:.2f} p50:{:.2f} p90:{:.2f} p99:{:.2f} p99.9:{:.2f} max:{:.2f}", sorted.front(),
+         quantile(sorted, 0.5), quantile(sorted, 0.9), quantile(sorted, 0.99), quantile(sorted, 0.999),
+         sorted.back());
+
+    // power of two buckets
+    auto upper = 1.0;
+    auto it = sorted.begin();
+    while (it != sorted.end()) {
+      const auto end = std::upper_bound(it, sorted.end(), upper);
+      if (end != it) {
+        const auto count = std::distance(it, end);
+        LOGI("  <= {:>8.0f}ms {:>6} {}", upper, count,
+             std::string(static_cast<std::size_t>(60 * count / sorted.size()), '#'));
+      }
+      it = end;
+      upper *= 2;
+    }
+
+    const auto now = Clock::now();
+    for (std::size_t i = 0; i < peers_.size(); ++i) {
+      const auto& stats = stats_[i];
+      LOGI("Peer {} attempts:{} failures:{} latency:{:.2f}ms health:{:.2f}", describe(peers_[i]), stats.attempts,
+           stats.failures, Latency(stats, now), Health(stats, now));
+    }
+  }
+
+ private:
+  struct Stats {
+    int outstanding = 0;
+    double latency = 0;  // exponentially weighted moving average in ms
+    double health = 1;   // 0 is dead, 1 is healthy
+    Clock::time_point updated = Clock::now();
+    std::size_t attempts = 0;
+    std::size_t failures = 0;
+  };
+
+  // shared between Run and the attempts of one request
+  struct Race {
+    std::mutex mutex;
+    std::condition_variable cv;
+    int pending = 0;
+    std::optional<std::size_t> winner;
+    Result result;
+  };
+
+  /**
+   * @brief failures fade out over time so a recovered peer gets traffic again
+   */
+  auto Health(const Stats& stats, Clock::time_point now) const -> double {
+    const Millis since = now - stats.updated;
+    const Millis recovery = options_.recovery;
+    return 1.0 - (1.0 - stats.health) * std::exp(-since.count() / recovery.count());
+  }
+
+  /**
+   * @brief latency fades out while a peer gets no traffic, so a peer that was slow once is probed again
+   */
+  auto Latency(const Stats& stats, Clock::time_point now) const -> double {
+    const Millis since = now - stats.updated;
+    const Millis forget = options_.forget;
+    return stats.latency * std::exp(-since.count() / forget.count());
+  }
+
+  /**
+   * @brief least outstanding, scaled by latency and divided by health
+   */
+  auto Cost(const Stats& stats, Clock::time_point now) const -> double {
+    const auto latency = std::max(Latency(stats, now), 1.0);
+    return (stats.outstanding + 1) * latency / std::max(Health(stats, now), 0.01);
+  }
+
+  /**
+   * @brief cheapest untried peer, healthy peers first so a down peer is not tried before a slow but healthy one
+   */
+  auto Pick(std::vector<bool>& tried) -> std::optional<std::size_t> {
+    std::lock_guard guard(mutex_);
+    const auto now = Clock::now();
+    std::optional<std::size_t> best;
+    auto best_healthy = false;
+    auto best_cost = 0.0;
+    for (std::size_t i = 0; i < peers_.size(); ++i) {
+      if (tried[i]) {
+        continue;
+      }
+      const auto healthy = Health(stats_[i], now) >= options_.min_health;
+      const auto cost = Cost(stats_[i], now);
+      if (!best || (healthy && !best_healthy) || (healthy == best_healthy && cost < best_cost)) {
+        best = i;
+        best_healthy = healthy;
+        best_cost = cost;
+      }
+    }
+    if (best) {
+      tried[*best] = true;
+    }
+    return best;
+  }
+
+  auto HedgeDelay() const -> Millis {
+    std::lock_guard guard(mutex_);
+    if (recent_.size() < 16) {
+      return options_.initial_hedge_delay;
+    }
+    return std::max(options_.min_hedge_delay, Millis(RecentQuantile()));
+  }
+
+  /**
+   * @brief hedge quantile of recent successful latencies, the caller must hold mutex_
+   */
+  auto RecentQuantile() const -> double {
+    std::vector<double> sorted(recent_.begin(), recent_.end());
+    std::sort(sorted.begin(), sorted.end());
+    return quantile(sorted, options_.hedge_quantile);
+  }
+
+  /**
+   * @brief start an attempt on its own thread, the caller must hold race->mutex
+   */
+  void Launch(std::size_t index, const Operation& op, const std::shared_ptr<Race>& race) {
+    ++race->pending;
+
+    std::lock_guard guard(mutex_);
+    ++stats_[index].outstanding;
+    ++stats_[index].attempts;
+
+    // drop finished attempts so repeated requests do not pile up futures
+    stragglers_.erase(std::remove_if(stragglers_.begin(), stragglers_.end(),
+                                     [](const std::future<void>& f) {
+                                       return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+                                     }),
+                      stragglers_.end());
+
+    stragglers_.push_back(std::async(std::launch::async, [this, index, op, race, peer = peers_[index]] {
+      const auto start = Clock::now();
+      const auto result = op(peer);
+      Complete(index, Clock::now() - start, result);
+
+      std::lock_guard lock(race->mutex);
+      --race->pending;
+      if (!race->winner) {
+        if (result.cond.good()) {
+          race->winner = index;
+        }
+        race->result = result;
+      }
+      race->cv.notify_all();
+    }));
+  }
+
+  void Complete(std::size_t index, Millis elapsed, const Result& result) {
+    std::lock_guard guard(mutex_);
+    auto& stats = stats_[index];
+    const auto now = Clock::now();
+    --stats.outstanding;
+    stats.latency = Latency(stats, now);
+    const auto latency = stats.latency > 0 ? 0.8 * stats.latency + 0.2 * elapsed.count() : elapsed.count();
+    if (result.cond.good()) {
+      stats.latency = latency;
+    } else {
+      // a quick refusal must not make a dead peer look fast, charge at least what a successful request takes
+      const auto observed = recent_.empty() ? Millis(options_.initial_hedge_delay).count() : RecentQuantile();
+      stats.latency = std::max({stats.latency, latency, observed});
+    }
+    stats.health = Health(stats, now);
+    stats.updated = now;
+
+    if (result.cond.good()) {
+      stats.health = 0.7 * stats.health + 0.3;
+      recent_.push_back(elapsed.count());
+      if (recent_.size() > options_.window) {
+        recent_.pop_front();
+      }
+      return;
+    }
+
+    ++stats.failures;
+    // a peer refusing associations is most likely down, stay away from it
+    stats.health *= result.associated ? 0.7 : 0.1;
+    LOGW("{} failed after {:.2f}ms:{}", describe(peers_[index]), elapsed.count(), err_msg(result.cond));
+  }
+
+  std::vector<Peer> peers_;
+  std::vector<Stats> stats_;
+  Options options_;
+
+  mutable std::mutex mutex_;
+  std::deque<double> recent_;     // latencies of recent successful attempts
+  std::vector<double> latencies_;  // latencies of all requests
+  std::vector<std::future<void>> stragglers_;
+  std::size_t hedges_ = 0;
+  std::size_t hedge_wins_ = 0;
+  std::size_t failovers_ = 0;
+  std::size_t failures_ = 0;
+};
+
+/**
+ * @brief options shared by all SCUs to describe the peer group
+ */
+inline void add_options(cxxopts::Options& options, const std::string& host, int port,
+                        const std::string& title = "ANY_SCP") {
+  // clang-format off
+  options.add_options("Peer")
+  ("H,host", "Server address", cxxopts::value<std::string>()->default_value(host))
+  ("p,port", "Server port", cxxopts::value<int>()->default_value(std::to_string(port)))
+  ("t,title", "Server Application title", cxxopts::value<std::string>()->default_value(title))
+  ("r,replicas", "Replicas of the server, comma separated host:port", cxxopts::value<std::string>()->default_value(""))
+  ("c,connect-timeout", "TCP connect timeout in seconds", cxxopts::value<int>()->default_value("3"))
+  ("acse-timeout", "Association request and release timeout in seconds", cxxopts::value<int>()->default_value("3"))
+  ("dimse-timeout", "DIMSE message timeout in seconds", cxxopts::value<int>()->default_value("5"))
+  ("n,repeat", "Number of requests to send", cxxopts::value<int>()->default_value("1"))
+  ("no-hedge", "Do not hedge idempotent requests to a second peer");
+  // clang-format on
+}
+
+inline auto peers_from_args(const cxxopts::ParseResult& args) {
+  const auto title = args["title"].as<std::string>();
+  std::vector<Peer> peers{{args["host"].as<std::string>(), args["port"].as<int>(), title}};
+
+  const auto replicas = args["replicas"].as<std::string>();
+  std::string_view rest = replicas;
+  while (!rest.empty()) {
+    const auto comma = rest.find(',');
+    const auto replica = rest.substr(0, comma);
+    rest = comma == std::string_view::npos ? std::string_view() : rest.substr(comma + 1);
+    if (replica.empty()) {
+      continue;
+    }
+
+    const auto colon = replica.rfind(':');
+    const auto port = colon == std::string_view::npos ? 0 : std::atoi(std::string(replica.substr(colon + 1)).c_str());
+    if (colon == 0 || port <= 0) {
+      LOGW("Ignore replica {}, expect host:port", replica);
+      continue;
+    }
+    peers.push_back({std::string(replica.substr(0, colon)), port, title});
+  }
+
+  return peers;
+}
+
+inline auto timeouts_from_args(const cxxopts::ParseResult& args) {
+  Timeouts timeouts;
+  timeouts.connect = args["connect-timeout"].as<int>();
+  timeouts.acse = args["acse-timeout"].as<int>();
+  timeouts.dimse = args["dimse-timeout"].as<int>();
+  return timeouts;
+}
+
+inline auto options_from_args(const cxxopts::ParseResult& args) {
+  Options options;
+  options.hedge = args.count("no-hedge") == 0;
+  return options;
+}
+
+}  // namespace peer
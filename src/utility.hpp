@@ -5,7 +5,7 @@
 #include "dcmtk/dcmnet/cond.h"
 #include "dcmtk/ofstd/ofcond.h"
 
-inline auto err_msg(OFCondition& cond) {
+inline auto err_msg(const OFCondition& cond) {
   OFString msg;
   return DimseCondition::dump(msg, cond);
 }